@@ -0,0 +1,398 @@
+/*
+ *  Copyright (C) 2013  Regents of the University of Michigan
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//////////////////////////////////////////////////////////////////////////
+// This file contains the processing for writing BGZF files at a
+// user specified compression level.
+
+#include <iostream>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "BgzfCompress.h"
+
+#ifdef GLFUTIL_LIBDEFLATE
+#include "libdeflate.h"
+#else
+#include <zlib.h>
+#endif
+
+// Same block sizes as the BGZF writer in libStatGen: at most 0xff00
+// bytes of input per block so even incompressible data fits in the
+// 64K maximum block size.
+static const int BGZF_MAX_BLOCK_SIZE = 0x10000;
+static const int BGZF_INPUT_BLOCK_SIZE = 0xff00;
+static const int BGZF_HEADER_SIZE = 18;
+static const int BGZF_FOOTER_SIZE = 8;
+
+static const unsigned char BGZF_EOF_BLOCK[28] =
+{
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0xff, 0x06, 0x00, 0x42, 0x43, 0x02, 0x00,
+    0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00
+};
+
+
+static void packInt16(unsigned char* buffer, uint16_t value)
+{
+    buffer[0] = value & 0xff;
+    buffer[1] = value >> 8;
+}
+
+
+static void packInt32(unsigned char* buffer, uint32_t value)
+{
+    buffer[0] = value & 0xff;
+    buffer[1] = (value >> 8) & 0xff;
+    buffer[2] = (value >> 16) & 0xff;
+    buffer[3] = (value >> 24) & 0xff;
+}
+
+
+// Deflate wrapper around the compile time selected backend.
+class Deflater
+{
+public:
+    Deflater(int level);
+    ~Deflater();
+    bool isValid();
+    // Returns the number of compressed bytes, or 0 on failure.
+    int deflate(const unsigned char* in, int inLen,
+                unsigned char* out, int outLen);
+    uint32_t crc(const unsigned char* in, int inLen);
+
+private:
+#ifdef GLFUTIL_LIBDEFLATE
+    struct libdeflate_compressor* myCompressor;
+#else
+    z_stream myStream;
+    bool myValid;
+#endif
+};
+
+
+#ifdef GLFUTIL_LIBDEFLATE
+
+Deflater::Deflater(int level)
+{
+    // libdeflate supports levels up to 12, so use its maximum
+    // when the maximum zlib level is requested.
+    if(level == BgzfCompress::MAX_LEVEL)
+    {
+        level = 12;
+    }
+    myCompressor = libdeflate_alloc_compressor(level);
+}
+
+Deflater::~Deflater()
+{
+    if(myCompressor != NULL)
+    {
+        libdeflate_free_compressor(myCompressor);
+    }
+}
+
+bool Deflater::isValid()
+{
+    return(myCompressor != NULL);
+}
+
+int Deflater::deflate(const unsigned char* in, int inLen,
+                      unsigned char* out, int outLen)
+{
+    return(libdeflate_deflate_compress(myCompressor, in, inLen, out, outLen));
+}
+
+uint32_t Deflater::crc(const unsigned char* in, int inLen)
+{
+    return(libdeflate_crc32(0, in, inLen));
+}
+
+#else
+
+Deflater::Deflater(int level)
+{
+    myStream.zalloc = NULL;
+    myStream.zfree = NULL;
+    myStream.opaque = NULL;
+    // Negative window bits for a raw deflate stream, the gzip
+    // wrapper is written separately.
+    myValid = (deflateInit2(&myStream, level, Z_DEFLATED, -15, 8,
+                            Z_DEFAULT_STRATEGY) == Z_OK);
+}
+
+Deflater::~Deflater()
+{
+    if(myValid)
+    {
+        deflateEnd(&myStream);
+    }
+}
+
+bool Deflater::isValid()
+{
+    return(myValid);
+}
+
+int Deflater::deflate(const unsigned char* in, int inLen,
+                      unsigned char* out, int outLen)
+{
+    if(deflateReset(&myStream) != Z_OK)
+    {
+        return(0);
+    }
+    myStream.next_in = (Bytef*)in;
+    myStream.avail_in = inLen;
+    myStream.next_out = out;
+    myStream.avail_out = outLen;
+    if(::deflate(&myStream, Z_FINISH) != Z_STREAM_END)
+    {
+        return(0);
+    }
+    return(outLen - myStream.avail_out);
+}
+
+uint32_t Deflater::crc(const unsigned char* in, int inLen)
+{
+    return(crc32(crc32(0L, NULL, 0L), (const Bytef*)in, inLen));
+}
+
+#endif
+
+
+BgzfCompress::BgzfCompress()
+    : myDeflater(NULL),
+      myOutFile(NULL),
+      myReadFd(-1),
+      myWriteFd(-1),
+      myRunning(false),
+      myStatus(false),
+      myInBuffer(new unsigned char[BGZF_INPUT_BLOCK_SIZE]),
+      myOutBuffer(new unsigned char[BGZF_MAX_BLOCK_SIZE])
+{
+    myInputName[0] = '\0';
+}
+
+
+BgzfCompress::~BgzfCompress()
+{
+    close();
+    delete[] myInBuffer;
+    delete[] myOutBuffer;
+}
+
+
+bool BgzfCompress::open(const char* outName, int level)
+{
+    // Finish any previous file.
+    close();
+
+    if((level < MIN_LEVEL) || (level > MAX_LEVEL))
+    {
+        std::cerr << "Invalid compression level: " << level << std::endl;
+        return(false);
+    }
+
+    myDeflater = new Deflater(level);
+    if(!myDeflater->isValid())
+    {
+        std::cerr << "Failed to initialize " << backendName()
+                  << " at level " << level << std::endl;
+        delete myDeflater;
+        myDeflater = NULL;
+        return(false);
+    }
+
+    myOutFile = fopen(outName, "wb");
+    if(myOutFile == NULL)
+    {
+        std::cerr << "Failed to open " << outName << " for writing\n";
+        delete myDeflater;
+        myDeflater = NULL;
+        return(false);
+    }
+
+    int fds[2];
+    if(pipe(fds) != 0)
+    {
+        std::cerr << "Failed to create a pipe to compress " << outName 
+                  << std::endl;
+        fclose(myOutFile);
+        myOutFile = NULL;
+        delete myDeflater;
+        myDeflater = NULL;
+        return(false);
+    }
+    myReadFd = fds[0];
+    myWriteFd = fds[1];
+    // The writer opens its own descriptor for the pipe by name.
+    snprintf(myInputName, sizeof(myInputName), "/dev/fd/%d", myWriteFd);
+
+    myStatus = true;
+    if(pthread_create(&myThread, NULL, compressThread, this) != 0)
+    {
+        std::cerr << "Failed to start compressing " << outName << std::endl;
+        myStatus = false;
+        ::close(myReadFd);
+        ::close(myWriteFd);
+        myReadFd = -1;
+        myWriteFd = -1;
+        fclose(myOutFile);
+        myOutFile = NULL;
+        delete myDeflater;
+        myDeflater = NULL;
+        return(false);
+    }
+    myRunning = true;
+
+    // If compressing fails the pipe is closed while the GlfFile may
+    // still be writing, so ignore SIGPIPE until close to have the
+    // write fail and the error returned from close rather than
+    // being killed by the signal.
+    struct sigaction ignoreSigPipe;
+    memset(&ignoreSigPipe, 0, sizeof(ignoreSigPipe));
+    ignoreSigPipe.sa_handler = SIG_IGN;
+    sigemptyset(&ignoreSigPipe.sa_mask);
+    sigaction(SIGPIPE, &ignoreSigPipe, &myOldSigPipe);
+    return(true);
+}
+
+
+const char* BgzfCompress::getInputName()
+{
+    return(myInputName);
+}
+
+
+bool BgzfCompress::close()
+{
+    if(!myRunning)
+    {
+        return(false);
+    }
+
+    // Once this and the writer's descriptor are closed, the
+    // compress thread reads end of file and finishes.
+    ::close(myWriteFd);
+    myWriteFd = -1;
+    pthread_join(myThread, NULL);
+    myRunning = false;
+    sigaction(SIGPIPE, &myOldSigPipe, NULL);
+    if(fclose(myOutFile) != 0)
+    {
+        myStatus = false;
+    }
+    myOutFile = NULL;
+    delete myDeflater;
+    myDeflater = NULL;
+    myInputName[0] = '\0';
+    return(myStatus);
+}
+
+
+void* BgzfCompress::compressThread(void* compressor)
+{
+    ((BgzfCompress*)compressor)->compress();
+    return(NULL);
+}
+
+
+void BgzfCompress::compress()
+{
+    bool endOfFile = false;
+    while(!endOfFile)
+    {
+        // Fill a block, the pipe may return less than requested.
+        int inLen = 0;
+        while(inLen < BGZF_INPUT_BLOCK_SIZE)
+        {
+            ssize_t numRead = read(myReadFd, myInBuffer + inLen,
+                                   BGZF_INPUT_BLOCK_SIZE - inLen);
+            if(numRead > 0)
+            {
+                inLen += numRead;
+            }
+            else if(numRead == 0)
+            {
+                endOfFile = true;
+                break;
+            }
+            else if(errno != EINTR)
+            {
+                myStatus = false;
+                endOfFile = true;
+                break;
+            }
+        }
+
+        // After a failure, keep draining the pipe so the writer
+        // does not block.
+        if((inLen == 0) || !myStatus)
+        {
+            continue;
+        }
+
+        int compLen = 
+            myDeflater->deflate(myInBuffer, inLen, 
+                                myOutBuffer + BGZF_HEADER_SIZE,
+                                BGZF_MAX_BLOCK_SIZE - 
+                                BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE);
+        if(compLen <= 0)
+        {
+            myStatus = false;
+            continue;
+        }
+        int blockLen = BGZF_HEADER_SIZE + compLen + BGZF_FOOTER_SIZE;
+
+        // gzip header with the BGZF "BC" extra subfield.
+        memcpy(myOutBuffer, BGZF_EOF_BLOCK, BGZF_HEADER_SIZE - 2);
+        packInt16(myOutBuffer + 16, blockLen - 1);
+        packInt32(myOutBuffer + BGZF_HEADER_SIZE + compLen,
+                  myDeflater->crc(myInBuffer, inLen));
+        packInt32(myOutBuffer + BGZF_HEADER_SIZE + compLen + 4, inLen);
+
+        if(fwrite(myOutBuffer, 1, blockLen, myOutFile) != (size_t)blockLen)
+        {
+            myStatus = false;
+        }
+    }
+
+    if(myStatus &&
+       (fwrite(BGZF_EOF_BLOCK, 1, sizeof(BGZF_EOF_BLOCK), myOutFile) != 
+        sizeof(BGZF_EOF_BLOCK)))
+    {
+        myStatus = false;
+    }
+
+    // Closed here rather than in close so a writer is not left
+    // blocked on a full pipe if reading failed.
+    ::close(myReadFd);
+    myReadFd = -1;
+}
+
+
+const char* BgzfCompress::backendName()
+{
+#ifdef GLFUTIL_LIBDEFLATE
+    return("libdeflate");
+#else
+    return("zlib");
+#endif
+}
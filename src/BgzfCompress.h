@@ -0,0 +1,78 @@
+/*
+ *  Copyright (C) 2013  Regents of the University of Michigan
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//////////////////////////////////////////////////////////////////////////
+// This file contains the processing for writing BGZF files at a
+// user specified compression level.  The deflate backend is selected
+// at compile time: libdeflate if GLFUTIL_LIBDEFLATE is defined,
+// otherwise zlib.
+
+#ifndef __BGZF_COMPRESS_H__
+#define __BGZF_COMPRESS_H__
+
+#include <stdio.h>
+#include <pthread.h>
+#include <signal.h>
+
+class Deflater;
+
+/// Compresses the data written to a pipe into a BGZF file in a
+/// background thread, so a GlfFile opened uncompressed on the pipe
+/// writes BGZF at the requested level without a temporary file.
+class BgzfCompress
+{
+public:
+    static const int MIN_LEVEL = 0;
+    static const int MAX_LEVEL = 9;
+
+    BgzfCompress();
+    ~BgzfCompress();
+
+    /// Start compressing into outName at the specified level (0-9).
+    /// Returns true on success, false on failure.
+    bool open(const char* outName, int level);
+
+    /// Return the name to write the uncompressed data to, valid
+    /// between open and close.
+    const char* getInputName();
+
+    /// Finish compressing once the writer has closed the input name.
+    /// Returns true if the whole file was successfully written.
+    bool close();
+
+    /// Return the name of the deflate backend compiled in.
+    static const char* backendName();
+
+private:
+    static void* compressThread(void* compressor);
+    void compress();
+
+    Deflater* myDeflater;
+    FILE* myOutFile;
+    int myReadFd;
+    int myWriteFd;
+    char myInputName[32];
+    pthread_t myThread;
+    // SIGPIPE handling to restore on close.
+    struct sigaction myOldSigPipe;
+    bool myRunning;
+    bool myStatus;
+    unsigned char* myInBuffer;
+    unsigned char* myOutBuffer;
+};
+
+#endif
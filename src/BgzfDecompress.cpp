@@ -0,0 +1,428 @@
+/*
+ *  Copyright (C) 2013  Regents of the University of Michigan
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//////////////////////////////////////////////////////////////////////////
+// This file contains the processing for reading BGZF files with the
+// deflate backend selected at compile time.
+
+#include <iostream>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include "BgzfDecompress.h"
+
+#ifdef GLFUTIL_LIBDEFLATE
+#include "libdeflate.h"
+#else
+#include <zlib.h>
+#endif
+
+static const int BGZF_MAX_BLOCK_SIZE = 0x10000;
+// gzip header up to and including XLEN.
+static const int GZIP_HEADER_SIZE = 12;
+static const int BGZF_FOOTER_SIZE = 8;
+
+
+static uint16_t unpackInt16(const unsigned char* buffer)
+{
+    return(buffer[0] | (buffer[1] << 8));
+}
+
+
+static uint32_t unpackInt32(const unsigned char* buffer)
+{
+    return(buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | 
+           ((uint32_t)buffer[3] << 24));
+}
+
+
+// Check for the gzip magic with the extra field flag set.
+static bool isGzipExtraHeader(const unsigned char* header)
+{
+    return((header[0] == 0x1f) && (header[1] == 0x8b) && 
+           (header[2] == 0x08) && ((header[3] & 0x04) != 0));
+}
+
+
+// Inflate wrapper around the compile time selected backend.
+class Inflater
+{
+public:
+    Inflater();
+    ~Inflater();
+    bool isValid();
+    // Returns the number of inflated bytes, or -1 on failure.
+    int inflate(const unsigned char* in, int inLen,
+                unsigned char* out, int outLen);
+    uint32_t crc(const unsigned char* in, int inLen);
+
+private:
+#ifdef GLFUTIL_LIBDEFLATE
+    struct libdeflate_decompressor* myDecompressor;
+#else
+    z_stream myStream;
+    bool myValid;
+#endif
+};
+
+
+#ifdef GLFUTIL_LIBDEFLATE
+
+Inflater::Inflater()
+{
+    myDecompressor = libdeflate_alloc_decompressor();
+}
+
+Inflater::~Inflater()
+{
+    if(myDecompressor != NULL)
+    {
+        libdeflate_free_decompressor(myDecompressor);
+    }
+}
+
+bool Inflater::isValid()
+{
+    return(myDecompressor != NULL);
+}
+
+int Inflater::inflate(const unsigned char* in, int inLen,
+                      unsigned char* out, int outLen)
+{
+    size_t actualLen = 0;
+    if(libdeflate_deflate_decompress(myDecompressor, in, inLen, out, outLen,
+                                     &actualLen) != LIBDEFLATE_SUCCESS)
+    {
+        return(-1);
+    }
+    return(actualLen);
+}
+
+uint32_t Inflater::crc(const unsigned char* in, int inLen)
+{
+    return(libdeflate_crc32(0, in, inLen));
+}
+
+#else
+
+Inflater::Inflater()
+{
+    myStream.zalloc = NULL;
+    myStream.zfree = NULL;
+    myStream.opaque = NULL;
+    myStream.next_in = NULL;
+    myStream.avail_in = 0;
+    // Negative window bits for a raw deflate stream, the gzip
+    // wrapper is parsed separately.
+    myValid = (inflateInit2(&myStream, -15) == Z_OK);
+}
+
+Inflater::~Inflater()
+{
+    if(myValid)
+    {
+        inflateEnd(&myStream);
+    }
+}
+
+bool Inflater::isValid()
+{
+    return(myValid);
+}
+
+int Inflater::inflate(const unsigned char* in, int inLen,
+                      unsigned char* out, int outLen)
+{
+    if(inflateReset(&myStream) != Z_OK)
+    {
+        return(-1);
+    }
+    myStream.next_in = (Bytef*)in;
+    myStream.avail_in = inLen;
+    myStream.next_out = out;
+    myStream.avail_out = outLen;
+    if(::inflate(&myStream, Z_FINISH) != Z_STREAM_END)
+    {
+        return(-1);
+    }
+    return(outLen - myStream.avail_out);
+}
+
+uint32_t Inflater::crc(const unsigned char* in, int inLen)
+{
+    return(crc32(crc32(0L, NULL, 0L), (const Bytef*)in, inLen));
+}
+
+#endif
+
+
+BgzfDecompress::BgzfDecompress()
+    : myInflater(NULL),
+      myInFile(NULL),
+      myWriteFd(-1),
+      myStdinFd(-1),
+      myRunning(false),
+      myStatus(false),
+      myInBuffer(new unsigned char[BGZF_MAX_BLOCK_SIZE]),
+      myOutBuffer(new unsigned char[BGZF_MAX_BLOCK_SIZE])
+{
+}
+
+
+BgzfDecompress::~BgzfDecompress()
+{
+    close();
+    delete[] myInBuffer;
+    delete[] myOutBuffer;
+}
+
+
+bool BgzfDecompress::open(const char* inName)
+{
+    // Finish any previous file.
+    close();
+
+    // Reading from stdin is left to GlfFile.
+    if(strcmp(inName, "-") == 0)
+    {
+        return(false);
+    }
+
+    myInFile = fopen(inName, "rb");
+    if(myInFile == NULL)
+    {
+        return(false);
+    }
+
+    // Only handle BGZF, anything else is read directly.
+    unsigned char header[GZIP_HEADER_SIZE + 4];
+    if((fread(header, 1, sizeof(header), myInFile) != sizeof(header)) ||
+       !isGzipExtraHeader(header) || 
+       (header[GZIP_HEADER_SIZE] != 'B') || 
+       (header[GZIP_HEADER_SIZE + 1] != 'C') ||
+       (fseek(myInFile, 0, SEEK_SET) != 0))
+    {
+        fclose(myInFile);
+        myInFile = NULL;
+        return(false);
+    }
+
+    myInflater = new Inflater();
+    int fds[2];
+    if(!myInflater->isValid() || (pipe(fds) != 0))
+    {
+        delete myInflater;
+        myInflater = NULL;
+        fclose(myInFile);
+        myInFile = NULL;
+        return(false);
+    }
+
+    // Replace stdin with the read end of the pipe, keeping the
+    // original to restore on close.
+    myStdinFd = dup(STDIN_FILENO);
+    dup2(fds[0], STDIN_FILENO);
+    ::close(fds[0]);
+    myWriteFd = fds[1];
+
+    myStatus = true;
+    if(pthread_create(&myThread, NULL, inflateThread, this) != 0)
+    {
+        myStatus = false;
+        ::close(myWriteFd);
+        myWriteFd = -1;
+        if(myStdinFd >= 0)
+        {
+            dup2(myStdinFd, STDIN_FILENO);
+            ::close(myStdinFd);
+            myStdinFd = -1;
+        }
+        delete myInflater;
+        myInflater = NULL;
+        fclose(myInFile);
+        myInFile = NULL;
+        return(false);
+    }
+    myRunning = true;
+    return(true);
+}
+
+
+const char* BgzfDecompress::getOutputName()
+{
+    return("-");
+}
+
+
+bool BgzfDecompress::close()
+{
+    if(!myRunning)
+    {
+        return(true);
+    }
+
+    // Restoring stdin closes the read end of the pipe, so if the
+    // reader stopped early the inflate thread's next write fails
+    // and it finishes.
+    if(myStdinFd >= 0)
+    {
+        dup2(myStdinFd, STDIN_FILENO);
+        ::close(myStdinFd);
+        myStdinFd = -1;
+    }
+    else
+    {
+        ::close(STDIN_FILENO);
+    }
+    pthread_join(myThread, NULL);
+    myRunning = false;
+
+    fclose(myInFile);
+    myInFile = NULL;
+    delete myInflater;
+    myInflater = NULL;
+    return(myStatus);
+}
+
+
+void* BgzfDecompress::inflateThread(void* decompressor)
+{
+    // Writing after the reader stopped early should fail with EPIPE
+    // rather than raise SIGPIPE.
+    sigset_t sigPipe;
+    sigemptyset(&sigPipe);
+    sigaddset(&sigPipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigPipe, NULL);
+
+    ((BgzfDecompress*)decompressor)->inflate();
+    return(NULL);
+}
+
+
+void BgzfDecompress::inflate()
+{
+    unsigned char header[GZIP_HEADER_SIZE];
+    while(true)
+    {
+        size_t numRead = fread(header, 1, GZIP_HEADER_SIZE, myInFile);
+        if((numRead == 0) && feof(myInFile))
+        {
+            // End of the file.
+            break;
+        }
+        if((numRead != (size_t)GZIP_HEADER_SIZE) || 
+           !isGzipExtraHeader(header))
+        {
+            myStatus = false;
+            break;
+        }
+
+        // Find the block size in the BC extra subfield.
+        int extraLen = unpackInt16(header + 10);
+        if(fread(myInBuffer, 1, extraLen, myInFile) != (size_t)extraLen)
+        {
+            myStatus = false;
+            break;
+        }
+        int blockSize = -1;
+        for(int i = 0; i + 4 <= extraLen; )
+        {
+            int subLen = unpackInt16(myInBuffer + i + 2);
+            if((myInBuffer[i] == 'B') && (myInBuffer[i+1] == 'C') &&
+               (subLen == 2) && (i + 6 <= extraLen))
+            {
+                blockSize = unpackInt16(myInBuffer + i + 4) + 1;
+                break;
+            }
+            i += 4 + subLen;
+        }
+        int remaining = blockSize - GZIP_HEADER_SIZE - extraLen;
+        int compLen = remaining - BGZF_FOOTER_SIZE;
+        if((blockSize < 0) || (compLen < 0) || 
+           (remaining > BGZF_MAX_BLOCK_SIZE))
+        {
+            myStatus = false;
+            break;
+        }
+
+        // Read the compressed data and footer.
+        if(fread(myInBuffer, 1, remaining, myInFile) != (size_t)remaining)
+        {
+            myStatus = false;
+            break;
+        }
+        uint32_t expectedCrc = unpackInt32(myInBuffer + compLen);
+        uint32_t expectedLen = unpackInt32(myInBuffer + compLen + 4);
+        if(expectedLen == 0)
+        {
+            // Empty block, like the EOF marker.
+            continue;
+        }
+        if(expectedLen > (uint32_t)BGZF_MAX_BLOCK_SIZE)
+        {
+            myStatus = false;
+            break;
+        }
+
+        int outLen = myInflater->inflate(myInBuffer, compLen, 
+                                         myOutBuffer, expectedLen);
+        if((outLen != (int)expectedLen) ||
+           (myInflater->crc(myOutBuffer, outLen) != expectedCrc))
+        {
+            myStatus = false;
+            break;
+        }
+
+        if(!writeAll(myOutBuffer, outLen))
+        {
+            // The reader stopped.
+            break;
+        }
+    }
+
+    // Closing the write end lets the reader see the end of the file.
+    ::close(myWriteFd);
+    myWriteFd = -1;
+}
+
+
+bool BgzfDecompress::writeAll(const unsigned char* buffer, int len)
+{
+    while(len > 0)
+    {
+        ssize_t numWritten = write(myWriteFd, buffer, len);
+        if(numWritten > 0)
+        {
+            buffer += numWritten;
+            len -= numWritten;
+        }
+        else if((numWritten < 0) && (errno != EINTR))
+        {
+            // EPIPE means the reader stopped early, which is not
+            // an error, anything else is.
+            if(errno != EPIPE)
+            {
+                myStatus = false;
+            }
+            return(false);
+        }
+    }
+    return(true);
+}
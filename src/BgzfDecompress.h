@@ -0,0 +1,70 @@
+/*
+ *  Copyright (C) 2013  Regents of the University of Michigan
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//////////////////////////////////////////////////////////////////////////
+// This file contains the processing for reading BGZF files with the
+// deflate backend selected at compile time: libdeflate if
+// GLFUTIL_LIBDEFLATE is defined, otherwise zlib.
+
+#ifndef __BGZF_DECOMPRESS_H__
+#define __BGZF_DECOMPRESS_H__
+
+#include <stdio.h>
+#include <pthread.h>
+
+class Inflater;
+
+/// Inflates a BGZF file in a background thread into a pipe that
+/// replaces stdin, so a GlfFile reading stdin ("-") as uncompressed
+/// reads the file without going through libStatGen's inflate.
+class BgzfDecompress
+{
+public:
+    BgzfDecompress();
+    ~BgzfDecompress();
+
+    /// Start inflating inName.
+    /// Returns false if inName is not a BGZF file or could not be
+    /// opened, in which case it should be read directly.
+    bool open(const char* inName);
+
+    /// Return the name to read the inflated data from, valid
+    /// between open and close.
+    const char* getOutputName();
+
+    /// Stop inflating once the reader has closed the output name,
+    /// which may be before the end of the file, and restore stdin.
+    /// Returns false if the file could not be read or was corrupt.
+    bool close();
+
+private:
+    static void* inflateThread(void* decompressor);
+    void inflate();
+    bool writeAll(const unsigned char* buffer, int len);
+
+    Inflater* myInflater;
+    FILE* myInFile;
+    int myWriteFd;
+    int myStdinFd;
+    pthread_t myThread;
+    bool myRunning;
+    bool myStatus;
+    unsigned char* myInBuffer;
+    unsigned char* myOutBuffer;
+};
+
+#endif
@@ -19,10 +19,12 @@
 // This file contains the processing for the executable option "dump"
 // which writes a file with the reads in the specified region.
 
+#include <stdlib.h>
 #include "Dump.h"
 #include "GlfFile.h"
 #include "Parameters.h"
 #include "BgzfFileType.h"
+#include "BgzfDecompress.h"
 
 Dump::Dump()
     : GlfExecutable()
@@ -47,6 +49,10 @@ void Dump::usage()
     std::cerr << "\tRequired Parameters:" << std::endl;
     std::cerr << "\t\t--in        : the GLF file to be read" << std::endl;
     std::cerr << "\tOptional Parameters For Other Operations:\n";
+    std::cerr << "\t\t--sampleRate : only print a random fraction, 0 to 1, of the records" << std::endl;
+    std::cerr << "\t\t--seed       : random seed for --sampleRate (defaults to 1)" << std::endl;
+    std::cerr << "\t\t--every      : only print every k-th record" << std::endl;
+    std::cerr << "\t\t--maxRecords : stop reading after printing this many records (defaults to 0, all)" << std::endl;
     std::cerr << "\t\t--params    : print the parameter settings" << std::endl;
     std::cerr << std::endl;
 }
@@ -57,12 +63,20 @@ int Dump::execute(int argc, char **argv)
     // Extract command line arguments.
     String inFile = "";
     bool params = false;
+    double sampleRate = 1.0;
+    int seed = 1;
+    int every = 1;
+    int maxRecords = 0;
 
     ParameterList inputParameters;
     BEGIN_LONG_PARAMETERS(longParameterList)
         LONG_PARAMETER_GROUP("Required Parameters")
         LONG_STRINGPARAMETER("in", &inFile)
         LONG_PARAMETER_GROUP("Optional Other Parameters")
+        LONG_DOUBLEPARAMETER("sampleRate", &sampleRate)
+        LONG_INTPARAMETER("seed", &seed)
+        LONG_INTPARAMETER("every", &every)
+        LONG_INTPARAMETER("maxRecords", &maxRecords)
         LONG_PARAMETER("params", &params)
         END_LONG_PARAMETERS();
    
@@ -80,6 +94,16 @@ int Dump::execute(int argc, char **argv)
         std::cerr << "Missing mandatory argument: --in" << std::endl;
         return(-1);
     }
+    if((sampleRate <= 0) || (sampleRate > 1) || (every < 1) || 
+       (maxRecords < 0))
+    {
+        usage();
+        inputParameters.Status();
+        std::cerr << "--sampleRate must be greater than 0 and at most 1, "
+                  << "--every must be at least 1, and "
+                  << "--maxRecords can not be negative" << std::endl;
+        return(-1);
+    }
     if(params)
     {
         inputParameters.Status();
@@ -87,9 +111,18 @@ int Dump::execute(int argc, char **argv)
 
     GlfFile glfIn;
     GlfHeader glfHeader;
+    BgzfDecompress inflater;
 
-    // Open the file for reading.   
-    glfIn.openForRead(inFile);
+    // Open the file for reading, inflating it with the compiled in
+    // deflate backend if it is BGZF.
+    if(inflater.open(inFile))
+    {
+        glfIn.openForRead(inflater.getOutputName());
+    }
+    else
+    {
+        glfIn.openForRead(inFile);
+    }
 
     // Read the glf header.
     glfIn.readHeader(glfHeader);
@@ -106,8 +139,13 @@ int Dump::execute(int argc, char **argv)
     // to the failure reason if any of the writes fail.
     GlfStatus::Status returnStatus = GlfStatus::SUCCESS;
     
+    srand(seed);
+    int64_t numRecords = 0;
+    int64_t numPrinted = 0;
+    bool done = false;
+
     GlfRefSection refSection;
-    while(glfIn.getNextRefSection(refSection))
+    while(!done && glfIn.getNextRefSection(refSection))
     {
         ++numSections;
         std::string refName;
@@ -119,13 +157,45 @@ int Dump::execute(int argc, char **argv)
         int pos = 0;
         while(glfIn.getNextRecord(record))
         {
-            // Print the position.
+            // The position is relative to the previous record, so it
+            // must be tracked even for records that are not printed.
             pos += record.getOffset();
+            ++numSectionRecords;
+            ++numRecords;
+
+            // Skip records that were not selected.
+            if((every > 1) && ((numRecords % every) != 0))
+            {
+                continue;
+            }
+            if((sampleRate < 1) && 
+               (rand() >= sampleRate * ((double)RAND_MAX + 1)))
+            {
+                continue;
+            }
+
+            // Print the position.
             std::cout << "position: " << pos << "\n\t";
             record.print();
-            ++numSectionRecords;
+            ++numPrinted;
+
+            if((maxRecords > 0) && (numPrinted >= maxRecords))
+            {
+                // Printed enough, so stop reading.
+                done = true;
+                break;
+            }
         }
     }
+
+    // Close the input before the inflater so it stops, even if
+    // reading stopped early.
+    glfIn.close();
+    if(!inflater.close())
+    {
+        std::cerr << "Failed to read " << inFile.c_str() << std::endl;
+        returnStatus = GlfStatus::FAIL_IO;
+    }
 //         // Keep reading records until they aren't anymore.
 //         while(glfIn.ReadRecord(glfHeader, glfRecord))
 //         {
@@ -23,10 +23,17 @@
 #include "GlfFile.h"
 #include "Parameters.h"
 #include "BgzfFileType.h"
+#include "BgzfDecompress.h"
+#include <unistd.h>
 
 Split::Split()
     : GlfExecutable(),
       myGlfOutName(""),
+      myLevelOutName(""),
+      myCompressor(),
+      myWriteFailed(false),
+      mySharedEmptyName(""),
+      myEmptyListFile(NULL),
       myOutDir(""),
       myOutBase(""),
       myOutFile(),
@@ -35,7 +42,10 @@ Split::Split()
       myOutEndPos(0),
       myChunkSize(0),
       myRecPos(0),
+      myLevel(-1),
       myEmptyGlfs(false),
+      myEmptyList(false),
+      myLinkEmpty(false),
       myRegionDirs(false)
 {
     
@@ -62,7 +72,10 @@ void Split::usage()
     std::cerr << "\t\t--outBase   : the base GLF filename to write (defaults to the same as the input GLF)" << std::endl;
     std::cerr << "\t\t--chunkSize : the region covered by each GLF file" << std::endl;
     std::cerr << "\t\t--emptyGlfs : write GLFs with just a header for intermediate chunks that are missing data" << std::endl;
+    std::cerr << "\t\t--emptyList : list intermediate chunks that are missing data in outBase.empty.txt, only writing their GLFs if --emptyGlfs is also specified" << std::endl;
+    std::cerr << "\t\t--linkEmpty : with --emptyGlfs, hard link each empty chunk to a single header only GLF, outBase.empty_header.glf.shared (named so it does not match outBase.*.glf)" << std::endl;
     std::cerr << "\t\t--regionDirs : write output GLFs in chr/start.end/ subdirectories" << std::endl;
+    std::cerr << "\t\t--level     : BGZF compression level, 0-9 (defaults to the library default), compressed with " << BgzfCompress::backendName() << std::endl;
     std::cerr << "\t\t--params    : print the parameter settings" << std::endl;
     std::cerr << std::endl;
 }
@@ -79,7 +92,13 @@ int Split::execute(int argc, char **argv)
     myOutEndPos = 0;
     myChunkSize = 5000000;
     myRecPos = 0;
+    myLevel = -1;
+    myWriteFailed = false;
+    mySharedEmptyName = "";
+    myEmptyListFile = NULL;
     myEmptyGlfs = false;
+    myEmptyList = false;
+    myLinkEmpty = false;
     myRegionDirs = false;
 
     ParameterList inputParameters;
@@ -91,7 +110,10 @@ int Split::execute(int argc, char **argv)
         LONG_STRINGPARAMETER("outBase", &myOutBase)
         LONG_INTPARAMETER("chunkSize", &myChunkSize)
         LONG_PARAMETER("emptyGlfs", &myEmptyGlfs)
+        LONG_PARAMETER("emptyList", &myEmptyList)
+        LONG_PARAMETER("linkEmpty", &myLinkEmpty)
         LONG_PARAMETER("regionDirs", &myRegionDirs)
+        LONG_INTPARAMETER("level", &myLevel)
         LONG_PARAMETER("params", &params)
         END_LONG_PARAMETERS();
    
@@ -110,6 +132,25 @@ int Split::execute(int argc, char **argv)
         return(-1);
     }
 
+    if((myLevel != -1) && 
+       ((myLevel < BgzfCompress::MIN_LEVEL) || 
+        (myLevel > BgzfCompress::MAX_LEVEL)))
+    {
+        usage();
+        inputParameters.Status();
+        std::cerr << "--level must be between " << BgzfCompress::MIN_LEVEL
+                  << " and " << BgzfCompress::MAX_LEVEL << std::endl;
+        return(-1);
+    }
+
+    if(myLinkEmpty && !myEmptyGlfs)
+    {
+        usage();
+        inputParameters.Status();
+        std::cerr << "--linkEmpty requires --emptyGlfs" << std::endl;
+        return(-1);
+    }
+
     // if outBase wasn't specified, base it on in.
     if(myOutBase.IsEmpty())
     {
@@ -136,9 +177,18 @@ int Split::execute(int argc, char **argv)
 
     GlfFile glfIn;
     GlfFile glfOut;
+    BgzfDecompress inflater;
 
-    // Open the files for reading.
-    glfIn.openForRead(inFile);
+    // Open the file for reading, inflating it with the compiled in
+    // deflate backend if it is BGZF.
+    if(inflater.open(inFile))
+    {
+        glfIn.openForRead(inflater.getOutputName());
+    }
+    else
+    {
+        glfIn.openForRead(inFile);
+    }
 
     // Read the glf header.
     glfIn.readHeader(myHeader);
@@ -148,6 +198,26 @@ int Split::execute(int argc, char **argv)
     // Set returnStatus to success.  It will be changed
     // to the failure reason if any of the writes fail.
     GlfStatus::Status returnStatus = GlfStatus::SUCCESS;
+
+    if(myEmptyList)
+    {
+        // Always create the listing, even if there are no empty chunks,
+        // so a listing from a previous run is not mistaken for this one.
+        String listName = "";
+        if(!myOutDir.IsEmpty())
+        {
+            system("mkdir -p " + myOutDir);
+            listName = myOutDir + '/';
+        }
+        listName += myOutBase + ".empty.txt";
+        myEmptyListFile = ifopen(listName, "w");
+        if(myEmptyListFile == NULL)
+        {
+            // Without the listing, empty chunks would be lost.
+            std::cerr << "Failed to open " << listName.c_str() << std::endl;
+            return(GlfStatus::FAIL_IO);
+        }
+    }
     
     while(glfIn.getNextRefSection(myRefSection))
     {
@@ -162,16 +232,45 @@ int Split::execute(int argc, char **argv)
 
         while(glfIn.getNextRecord(record))
         {
-            writeRecord(record, newRef);
+            if(!writeRecord(record, newRef))
+            {
+                myWriteFailed = true;
+                break;
+            }
             ++numSectionRecords;
             newRef = false;
         }
+        if(myWriteFailed)
+        {
+            break;
+        }
+    }
+
+    // Close the input before the inflater so it stops, even if
+    // reading stopped early.
+    glfIn.close();
+    if(!inflater.close())
+    {
+        std::cerr << "Failed to read " << inFile.c_str() << std::endl;
+        returnStatus = GlfStatus::FAIL_IO;
+    }
+
+    // Close the last output file and the listing.
+    closeOutGlf();
+    if((myEmptyListFile != NULL) && (ifclose(myEmptyListFile) != 0))
+    {
+        std::cerr << "Failed to close the empty chunk listing\n";
+        myWriteFailed = true;
+    }
+    if(myWriteFailed)
+    {
+        returnStatus = GlfStatus::FAIL_IO;
     }
      return(returnStatus);
 }
 
 
-void Split::writeRecord(GlfRecord& record, 
+bool Split::writeRecord(GlfRecord& record, 
                         bool newRef)
 {
     // Get the position for this record.
@@ -197,9 +296,9 @@ void Split::writeRecord(GlfRecord& record,
         std::string refName;
         myRefSection.getName(refName);
 
-        if(myEmptyGlfs)
+        if(myEmptyGlfs || myEmptyList)
         {
-            // Write empty glfs from the previous position to this one.
+            // Handle empty chunks from the previous position to this one.
             if(newRef)
             {
                 prevEndPos = 0;
@@ -208,17 +307,21 @@ void Split::writeRecord(GlfRecord& record,
             prevEndPos += myChunkSize;
             while(myOutEndPos != prevEndPos)
             {
-                // until we get to the current chunk, write empty GLFs.
-                genOutGlfName(prevStartPos, prevEndPos, refName);
+                // until we get to the current chunk, write empty chunks.
+                if(!writeEmptyChunk(prevStartPos, prevEndPos, refName))
+                {
+                    return(false);
+                }
                 prevEndPos += myChunkSize;
                 prevStartPos += myChunkSize;
-                myOutFile.openForWrite(myGlfOutName);
-                myOutFile.writeHeader(myHeader);
             }
         }
 
         genOutGlfName(startPos, myOutEndPos, refName);
-        myOutFile.openForWrite(myGlfOutName);
+        if(!openOutGlf())
+        {
+            return(false);
+        }
         myOutFile.writeHeader(myHeader);
         myOutFile.writeRefSection(myRefSection);
 
@@ -227,11 +330,110 @@ void Split::writeRecord(GlfRecord& record,
     }
 
     // Write the record.
-    myOutFile.writeRecord(record);
+    return(myOutFile.writeRecord(record));
 }
 
 
-void Split::genOutGlfName(uint32_t startPos, uint32_t endPos, const std::string& refName)
+bool Split::writeEmptyChunk(uint32_t startPos, uint32_t endPos, 
+                            const std::string& refName)
+{
+    // Only create the region directories if the GLF will be written.
+    genOutGlfName(startPos, endPos, refName, myEmptyGlfs);
+
+    if(myEmptyList)
+    {
+        // Adjust if at end of chromosome, same as the GLF name.
+        if(endPos > myRefSection.getRefLen())
+        {
+            endPos = myRefSection.getRefLen();
+        }
+        if(ifprintf(myEmptyListFile, "%s\t%u\t%u\t%s\n", refName.c_str(),
+                    startPos, endPos, myGlfOutName.c_str()) <= 0)
+        {
+            std::cerr << "Failed to list empty chunk " 
+                      << myGlfOutName.c_str() << std::endl;
+            return(false);
+        }
+    }
+
+    if(!myEmptyGlfs)
+    {
+        return(true);
+    }
+
+    if(myLinkEmpty)
+    {
+        // Close the previous file so it is not left open until the
+        // next chunk with data.
+        if(!closeOutGlf())
+        {
+            return(false);
+        }
+        if(linkEmptyGlf())
+        {
+            return(true);
+        }
+        if(myWriteFailed)
+        {
+            return(false);
+        }
+    }
+    if(!openOutGlf())
+    {
+        return(false);
+    }
+    myOutFile.writeHeader(myHeader);
+    return(true);
+}
+
+
+bool Split::linkEmptyGlf()
+{
+    if(mySharedEmptyName.IsEmpty())
+    {
+        // First empty chunk, so write the shared empty GLF, named
+        // so it is not picked up by globs for outBase.*.glf chunks.
+        // Only set mySharedEmptyName once it has been written.
+        String chunkName = myGlfOutName;
+        myGlfOutName.Clear();
+        if(!myOutDir.IsEmpty())
+        {
+            myGlfOutName = myOutDir + '/';
+        }
+        myGlfOutName += myOutBase + ".empty_header.glf.shared";
+        bool status = openOutGlf();
+        if(status)
+        {
+            myOutFile.writeHeader(myHeader);
+            status = closeOutGlf();
+        }
+        if(!status)
+        {
+            // Stop linking rather than failing for every empty chunk.
+            std::cerr << "Failed to write " << myGlfOutName.c_str()
+                      << ", writing empty GLFs instead of linking\n";
+            myLinkEmpty = false;
+            myGlfOutName = chunkName;
+            return(false);
+        }
+        mySharedEmptyName = myGlfOutName;
+        myGlfOutName = chunkName;
+    }
+
+    // Remove any GLF left from a previous run, link fails if it exists.
+    unlink(myGlfOutName.c_str());
+    if(link(mySharedEmptyName.c_str(), myGlfOutName.c_str()) != 0)
+    {
+        std::cerr << "Failed to link " << myGlfOutName.c_str() << " to "
+                  << mySharedEmptyName.c_str() << ", writing it instead\n";
+        return(false);
+    }
+    return(true);
+}
+
+
+void Split::genOutGlfName(uint32_t startPos, uint32_t endPos, 
+                          const std::string& refName, bool makeDirs)
 {
     // Adjust if at end of chromosome.
     if(endPos > myRefSection.getRefLen())
@@ -253,8 +455,71 @@ void Split::genOutGlfName(uint32_t startPos, uint32_t endPos, const std::string&
         myGlfOutName += ".";
         myGlfOutName += endPos;
         myGlfOutName += "/";
-        system("mkdir -p " + myGlfOutName);
+        if(makeDirs)
+        {
+            system("mkdir -p " + myGlfOutName);
+        }
     }
     myGlfOutName += myOutBase + '.' + refName.c_str() + '.' 
         + startPos + '.' + endPos + ".glf";
 }
+
+
+bool Split::openOutGlf()
+{
+    // Finish the previous file before starting the next, stopping
+    // if it could not be written.
+    if(!closeOutGlf())
+    {
+        return(false);
+    }
+
+    // Remove any existing file so the output gets a new inode,
+    // otherwise writing through a hard link left by a previous
+    // --linkEmpty run would overwrite every linked empty chunk.
+    unlink(myGlfOutName.c_str());
+
+    if(myLevel == -1)
+    {
+        // Use the default BGZF compression.
+        return(myOutFile.openForWrite(myGlfOutName));
+    }
+
+    // Write uncompressed into the compressor, which writes the
+    // GLF as BGZF at the requested level.
+    if(!myCompressor.open(myGlfOutName, myLevel))
+    {
+        return(false);
+    }
+    myLevelOutName = myGlfOutName;
+    if(!myOutFile.openForWrite(myCompressor.getInputName(), false))
+    {
+        // Stop the compressor and remove the GLF it started.
+        closeOutGlf();
+        remove(myGlfOutName.c_str());
+        return(false);
+    }
+    return(true);
+}
+
+
+bool Split::closeOutGlf()
+{
+    myOutFile.close();
+    if(myLevelOutName.IsEmpty())
+    {
+        return(true);
+    }
+
+    bool status = myCompressor.close();
+    if(!status)
+    {
+        // Do not leave a truncated GLF behind.
+        std::cerr << "Failed to compress " << myLevelOutName.c_str()
+                  << std::endl;
+        remove(myLevelOutName.c_str());
+        myWriteFailed = true;
+    }
+    myLevelOutName.Clear();
+    return(status);
+}
@@ -24,6 +24,8 @@
 
 #include "GlfExecutable.h"
 #include "GlfFile.h"
+#include "InputFile.h"
+#include "BgzfCompress.h"
 
 class Split : public GlfExecutable
 {
@@ -35,11 +37,27 @@ public:
     int execute(int argc, char **argv);
 
 private:
-    void writeRecord(GlfRecord& record, 
+    bool writeRecord(GlfRecord& record, 
                      bool newRef);
-    void genOutGlfName(uint32_t startPos, uint32_t endPos, const std::string& refName);
+    bool writeEmptyChunk(uint32_t startPos, uint32_t endPos, 
+                         const std::string& refName);
+    bool linkEmptyGlf();
+    void genOutGlfName(uint32_t startPos, uint32_t endPos, 
+                       const std::string& refName, bool makeDirs = true);
+    bool openOutGlf();
+    bool closeOutGlf();
 
     String myGlfOutName;
+    // When the compression level was specified, the GLF being
+    // compressed into, empty otherwise.
+    String myLevelOutName;
+    BgzfCompress myCompressor;
+    // Set if opening or compressing any of the output GLFs failed.
+    bool myWriteFailed;
+    // Header only GLF that empty chunks are hard linked to.
+    String mySharedEmptyName;
+    // Listing of the empty chunks.
+    IFILE myEmptyListFile;
     String myOutDir;
     String myOutBase;
     GlfFile myOutFile;
@@ -50,7 +68,11 @@ private:
     uint32_t myChunkSize;
     uint32_t myRecPos;
 
+    int myLevel;
+
     bool myEmptyGlfs;
+    bool myEmptyList;
+    bool myLinkEmpty;
     bool myRegionDirs;
 };
 